@@ -0,0 +1,370 @@
+// reader throughput benchmark
+//
+//   bench_readers [--dir DIR] [--sizes 4K,1M,64M,1G] [--cache warm,cold] [--min-time SEC]
+//                 [--out results.csv] [--baseline old.csv] [--threshold PERCENT]
+//
+// generates one synthetic text file per size (lines of 20..120 chars, also read as Record array),
+// runs every reader over it and writes one CSV row per (reader, size, cache):
+//   reader,size,cache,iterations,mb_per_s,syscalls,allocs,alloc_bytes
+// syscalls are read calls (syscr of /proc/self/io) and allocations counted by operator new, both per run.
+// cold runs drop the file (and its columnar copy) from the page cache with posix_fadvise(DONTNEED) before every run,
+// which only works for clean pages on a local filesystem, the rows say "cold" regardless.
+// with --baseline a row slower than the baseline by more than --threshold percent (default 10)
+// is reported and the exit code is 1.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <iomanip>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <new>
+#include <cstdlib>
+
+#include "readers.hpp"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static atomic<size_t> num_allocs{0};
+static atomic<size_t> alloc_bytes{0};
+
+// operator new and delete are replaced as a pair on top of malloc and free. once they are inlined GCC sees
+// free() on a pointer from operator new and warns, although both sides are these replacements
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new(size_t n) {
+    num_allocs.fetch_add(1, memory_order_relaxed);
+    alloc_bytes.fetch_add(n, memory_order_relaxed);
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+void* operator new[](size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+    #pragma GCC diagnostic pop
+#endif
+
+struct Counters {
+    size_t syscalls = 0;
+    size_t allocs = 0;
+    size_t alloc_bytes = 0;
+};
+
+static size_t read_syscalls() {
+    #ifdef LINUX_PLATFORM
+        ifstream io("/proc/self/io");
+        string key;
+        size_t value;
+        while (io >> key >> value) {
+            if (key == "syscr:") return value;
+        }
+    #endif
+    return 0;
+}
+
+static Counters snapshot() {
+    Counters c;
+    c.syscalls = read_syscalls();
+    c.allocs = num_allocs.load();
+    c.alloc_bytes = alloc_bytes.load();
+    return c;
+}
+
+static size_t parse_size(const string& s) {
+    size_t pos = 0;
+    double v = stod(s, &pos);
+    switch (pos < s.size() ? toupper(s[pos]) : 0) {
+        case 'K': v *= 1024; break;
+        case 'M': v *= 1024*1024; break;
+        case 'G': v *= 1024.0*1024*1024; break;
+    }
+    return static_cast<size_t>(v);
+}
+
+static vector<string> split(const string& s, char sep) {
+    vector<string> parts;
+    stringstream ss(s);
+    string part;
+    while (getline(ss, part, sep)) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+// text lines, reused for every file so that the sizes only differ in length
+static void generate(const fs::path& p, size_t size) {
+    if (fs::exists(p) && fs::file_size(p) == size) return;
+    ofstream ofs(p, ios::binary | ios::trunc);
+    if (!ofs) {
+        throw runtime_error("cannot open file: " + p.string());
+    }
+    mt19937_64 rng(42);
+    vector<char> block(1024*1024);
+    for (size_t i=0; i<block.size();) {
+        size_t len = 20 + rng() % 100;
+        for (size_t j=0; j<len && i<block.size(); ++j) block[i++] = static_cast<char>('a' + rng() % 26);
+        if (i < block.size()) block[i++] = '\n';
+    }
+    for (size_t done=0; done<size;) {
+        size_t n = min(block.size(), size - done);
+        ofs.write(block.data(), n);
+        done += n;
+    }
+}
+
+static void drop_cache(const fs::path& p) {
+    #ifdef LINUX_PLATFORM
+        int fd = open(p.c_str(), O_RDONLY);
+        if (fd == -1) return;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    #endif
+}
+
+static uint64_t checksum(const char* p, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i=0; i<n; ++i) sum += static_cast<unsigned char>(p[i]);
+    return sum;
+}
+
+// columnar copy of the records of a data file (RecordColumns::convert), made next to it for each size
+// and removed again once its rows are done
+static string columns_file(const string& f) { return f + ".columns"; }
+
+// every reader goes over the whole file and touches every byte it gets
+using ReadFn = function<uint64_t(const string&, size_t)>;
+
+static vector<pair<string, ReadFn>> readers() {
+    vector<pair<string, ReadFn>> r;
+    r.emplace_back("FileReader::readAll", [](const string& f, size_t) {
+        FileReader reader(f);
+        string s = reader.readAll();
+        return checksum(s.data(), s.size());
+    });
+    r.emplace_back("LineReader::processLineByLine", [](const string& f, size_t) {
+        LineReader reader(f);
+        uint64_t sum = 0;
+        reader.processLineByLine([&](string_view line) { sum += checksum(line.data(), line.size()); });
+        return sum;
+    });
+    for (size_t threads : {1, 0}) {
+        r.emplace_back(string("LineReader::findLines/") + (threads ? "1" : "all"), [threads](const string& f, size_t) {
+            LineReader reader(f);
+            uint64_t sum = 0;
+            for (const string& line : reader.findLines("xyz", threads)) sum += checksum(line.data(), line.size());
+            return sum;
+        });
+    }
+    for (size_t buf : {4096, 64*1024, 1024*1024}) {
+        r.emplace_back("BufferedReader::read/" + to_string(buf/1024) + "K", [buf](const string& f, size_t) {
+            BufferedReader reader(f, buf);
+            vector<char> chunk(64*1024);
+            uint64_t sum = 0;
+            while (size_t n = reader.read(chunk.data(), chunk.size())) sum += checksum(chunk.data(), n);
+            return sum;
+        });
+    }
+    r.emplace_back("BinaryReader<Record>::readArray", [](const string& f, size_t size) {
+        BinaryReader<Record> reader(f);
+        vector<Record> records = reader.readArray(size / sizeof(Record));
+        return checksum(reinterpret_cast<const char*>(records.data()), records.size()*sizeof(Record));
+    });
+    // aggregation over Record::value: AoS through the mapping, and the columnar copy (see columns_file)
+    r.emplace_back("RecordView<Record>::sum", [](const string& f, size_t) {
+        RecordView<Record> view(f);
+        double sum = 0;
+        for (const Record& rec : view.records()) sum += rec.value;
+        return static_cast<uint64_t>(sum != 0);
+    });
+    r.emplace_back("RecordColumns::sum", [](const string& f, size_t) {
+        RecordColumns columns(columns_file(f));
+        return static_cast<uint64_t>(columns.sum() != 0);
+    });
+    #ifdef LINUX_PLATFORM
+        for (bool uring : {true, false}) {
+            r.emplace_back(string("AsyncReader/") + (uring ? "io_uring" : "pread"), [uring](const string& f, size_t) {
+                AsyncReader::Options o;
+                o.useUring = uring;
+                o.queueDepth = 8;
+                o.buffersPerFile = 8;
+                // kept across runs, setting up the ring and the buffers is not part of the measurement
+                static unique_ptr<AsyncReader> readers[2];
+                if (!readers[uring]) readers[uring] = make_unique<AsyncReader>(o);
+                uint64_t sum = 0;
+                readers[uring]->readFiles({f}, [&](size_t, const char* data, size_t n) { sum += checksum(data, n); }, [](size_t, int error) {
+                    if (error != 0) throw runtime_error("read failed");
+                });
+                return sum;
+            });
+        }
+    #endif
+    r.emplace_back("MemoryMappedFile", [](const string& f, size_t) {
+        MemoryMappedFile mapped(f);
+        return checksum(mapped.getData(), mapped.getSize());
+    });
+    r.emplace_back("WindowedMappedFile/16M", [](const string& f, size_t) {
+        WindowedMappedFile::Options o;
+        o.dropBehind = false; // the cache state is up to --cache
+        WindowedMappedFile mapped(f, o);
+        uint64_t sum = 0;
+        for (span<const char> w = mapped.next(); !w.empty(); w = mapped.next()) sum += checksum(w.data(), w.size());
+        return sum;
+    });
+    return r;
+}
+
+struct Result {
+    string reader;
+    size_t size;
+    string cache;
+    size_t iterations;
+    double mb_per_s;
+    double syscalls;
+    double allocs;
+    double alloc_bytes;
+    string key() const { return reader + "," + to_string(size) + "," + cache; }
+};
+
+static map<string, double> load_baseline(const string& filename) {
+    map<string, double> baseline;
+    ifstream ifs(filename);
+    if (!ifs) {
+        throw runtime_error("cannot open file: " + filename);
+    }
+    string line;
+    getline(ifs, line); // header
+    while (getline(ifs, line)) {
+        vector<string> f = split(line, ',');
+        if (f.size() < 5) continue;
+        baseline[f[0] + "," + f[1] + "," + f[2]] = stod(f[4]);
+    }
+    return baseline;
+}
+
+int main(int argc, char* argv[]) {
+    fs::path dir = fs::temp_directory_path() / "bench_readers";
+    vector<string> sizes = {"4K", "64K", "1M", "64M", "1G"};
+    vector<string> caches = {"warm", "cold"};
+    double min_time = 0.5;
+    string out;
+    string baseline_file;
+    double threshold = 10;
+    for (int i=1; i<argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--dir" && i+1 < argc) {
+            dir = argv[++i];
+        } else if (arg == "--sizes" && i+1 < argc) {
+            sizes = split(argv[++i], ',');
+        } else if (arg == "--cache" && i+1 < argc) {
+            caches = split(argv[++i], ',');
+        } else if (arg == "--min-time" && i+1 < argc) {
+            min_time = stod(argv[++i]);
+        } else if (arg == "--out" && i+1 < argc) {
+            out = argv[++i];
+        } else if (arg == "--baseline" && i+1 < argc) {
+            baseline_file = argv[++i];
+        } else if (arg == "--threshold" && i+1 < argc) {
+            threshold = stod(argv[++i]);
+        } else {
+            cerr << "unknown argument: " << arg << endl;
+            return 2;
+        }
+    }
+    fs::create_directories(dir);
+    // read calls of snapshot() itself
+    Counters c0 = snapshot();
+    Counters c1 = snapshot();
+    const size_t overhead = c1.syscalls - c0.syscalls;
+
+    vector<Result> results;
+    for (const string& s : sizes) {
+        size_t size = parse_size(s);
+        fs::path file = dir / ("data_" + s + ".txt");
+        generate(file, size);
+        const string columns = columns_file(file.string());
+        RecordColumns::convert(file.string(), columns);
+        for (const string& cache : caches) {
+            for (const auto& [name, fn] : readers()) {
+                bool cold = cache == "cold";
+                fn(file.string(), size); // warm up, and fills the page cache for the warm runs
+                size_t iterations = 0;
+                double seconds = 0;
+                Counters total;
+                volatile uint64_t sink = 0;
+                while (iterations == 0 || seconds < min_time) {
+                    if (cold) {
+                        drop_cache(file);
+                        drop_cache(columns);
+                    }
+                    Counters c0 = snapshot();
+                    auto t0 = chrono::steady_clock::now();
+                    sink = sink + fn(file.string(), size);
+                    auto t1 = chrono::steady_clock::now();
+                    Counters c1 = snapshot();
+                    seconds += chrono::duration<double>(t1-t0).count();
+                    total.syscalls += c1.syscalls - c0.syscalls - overhead;
+                    total.allocs += c1.allocs - c0.allocs;
+                    total.alloc_bytes += c1.alloc_bytes - c0.alloc_bytes;
+                    iterations++;
+                }
+                Result r{name, size, cache, iterations, static_cast<double>(size)*iterations/seconds/1e6,
+                         static_cast<double>(total.syscalls)/iterations, static_cast<double>(total.allocs)/iterations,
+                         static_cast<double>(total.alloc_bytes)/iterations};
+                cerr << left << setw(36) << name << right << setw(6) << s << " " << setw(5) << cache
+                     << fixed << setprecision(1) << setw(10) << r.mb_per_s << " [MB/s]"
+                     << setprecision(0) << setw(10) << r.syscalls << " syscalls" << setw(10) << r.allocs << " allocs" << endl;
+                results.push_back(r);
+            }
+        }
+        fs::remove(columns);
+    }
+
+    ofstream ofs;
+    if (!out.empty()) {
+        ofs.open(out, ios::trunc);
+        if (!ofs) {
+            throw runtime_error("cannot open file: " + out);
+        }
+    }
+    ostream& os = out.empty() ? cout : ofs;
+    os << "reader,size,cache,iterations,mb_per_s,syscalls,allocs,alloc_bytes" << endl;
+    for (const Result& r : results) {
+        os << r.reader << "," << r.size << "," << r.cache << "," << r.iterations << "," << fixed << setprecision(1) << r.mb_per_s << ","
+           << r.syscalls << "," << r.allocs << "," << setprecision(0) << r.alloc_bytes << endl;
+    }
+
+    if (baseline_file.empty()) return 0;
+    map<string, double> baseline = load_baseline(baseline_file);
+    size_t regressions = 0;
+    for (const Result& r : results) {
+        auto it = baseline.find(r.key());
+        if (it == baseline.end() || it->second <= 0) continue;
+        double change = (r.mb_per_s / it->second - 1) * 100;
+        if (change < -threshold) {
+            cerr << "regression: " << r.key() << ": " << fixed << setprecision(1) << it->second << " -> " << r.mb_per_s
+                 << " [MB/s] (" << change << "%)" << endl;
+            regressions++;
+        }
+    }
+    if (regressions > 0) {
+        cerr << regressions << " regression(s) over " << threshold << "%" << endl;
+        return 1;
+    }
+    cerr << "no regressions over " << threshold << "% against " << baseline_file << endl;
+    return 0;
+}
@@ -0,0 +1,1227 @@
+#pragma once
+
+// file readers, shared by main and bench_readers
+
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <string_view>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <limits>
+#include <type_traits>
+#include <list>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+#if defined(__x86_64__)
+    #include <immintrin.h>
+#endif
+#ifdef LINUX_PLATFORM
+    #include <sys/syscall.h>
+    #include <sys/uio.h>
+    #include <linux/io_uring.h>
+#endif
+
+class FileReader {
+private:
+    std::ifstream file;
+public:
+    FileReader(const std::string& filename) : file(filename) {
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to open file");
+        }
+    }
+    std::string readAll() {
+        std::string content;
+        file.seekg(0, std::ios::end);
+        content.reserve(file.tellg());
+        file.seekg(0, std::ios::beg);
+        content.assign(
+            (std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>()
+        );
+        return content;
+    }
+    ~FileReader() {
+        if (file.is_open()) {
+            file.close();
+        }
+    }
+};
+
+template<typename T>
+class BinaryReader {
+private:
+    std::ifstream file;
+public:
+    BinaryReader(const std::string& filename) : file(filename, std::ios::binary) {
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to open binary file");
+        }
+    }
+    T readFixed() {
+        T data;
+        file.read(reinterpret_cast<char*>(&data), sizeof(T));
+        if (file.fail()) {
+            throw std::runtime_error("failed to load data");
+        }
+        return data;
+    }
+    std::vector<T> readArray(size_t count) {
+        std::vector<T> data(count);
+        file.read(reinterpret_cast<char*>(data.data()), count*sizeof(T));
+        if (file.fail()) {
+            throw std::runtime_error("failed to load array");
+        }
+        return data;
+    }
+    size_t getFileSize() {
+        file.seekg(0, std::ios::end);
+        size_t size = file.tellg();
+        file.seekg(0, std::ios::beg);
+        return size;
+    }
+};
+
+struct Record {
+    int id; // 4 byte
+    double value; // 8 byte
+    // int value; // 4 byte
+    char name[50]; // 50 byte
+};
+
+class MemoryMappedFile {
+public:
+    // access pattern hint for the whole mapping (madvise), Sequential also makes the kernel read ahead further
+    enum class Access {Normal, Sequential, Random};
+private:
+    #ifdef _WIN32
+        HANDLE fileHandle = INVALID_HANDLE_VALUE;
+        HANDLE mappingHandle = nullptr;
+    #else
+        int fd = -1;
+    #endif
+    void* mappedData = nullptr; // stays null for an empty file, nothing is mapped then
+    size_t fileSize = 0;
+public:
+    MemoryMappedFile(const std::string& filename, Access access=Access::Normal) {
+        #ifdef _WIN32
+            fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                     access == Access::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : access == Access::Random ? FILE_FLAG_RANDOM_ACCESS : FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (fileHandle == INVALID_HANDLE_VALUE) {
+                throw std::runtime_error("failed to open file");
+            }
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(fileHandle, &size)) {
+                CloseHandle(fileHandle);
+                throw std::runtime_error("failed to get file size");
+            }
+            fileSize = size.QuadPart;
+            if (fileSize == 0) return;
+            mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mappingHandle == nullptr) {
+                CloseHandle(fileHandle);
+                throw std::runtime_error("failed to make file mapping");
+            }
+            mappedData = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+            if (mappedData == nullptr) {
+                CloseHandle(mappingHandle);
+                CloseHandle(fileHandle);
+                throw std::runtime_error("failed to map memory");
+            }
+        #else
+            fd = open(filename.c_str(), O_RDONLY);
+            if (fd == -1) {
+                throw std::runtime_error("failed to open file");
+            }
+            struct stat sb;
+            if (fstat(fd, &sb) == -1) {
+                close(fd);
+                throw std::runtime_error("failed to get file information");
+            }
+            fileSize = sb.st_size;
+            if (fileSize == 0) return;
+            void* p = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("failed to map memory");
+            }
+            mappedData = p;
+            if (access != Access::Normal) madvise(mappedData, fileSize, access == Access::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+        #endif
+    }
+    MemoryMappedFile(const MemoryMappedFile&) = delete;
+    MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+    const char* getData() const { return static_cast<const char*>(mappedData); }
+    size_t getSize() const { return fileSize; }
+
+    ~MemoryMappedFile() {
+        #ifdef _WIN32
+            if (mappedData) UnmapViewOfFile(mappedData);
+            if (mappingHandle) CloseHandle(mappingHandle);
+            if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        #else
+            if (mappedData) munmap(mappedData, fileSize);
+            if (fd != -1) close(fd);
+        #endif
+    }
+};
+
+// sequential access to files too large to map at once: only a window of windowSize bytes is mapped,
+// so the address space and RSS stay bounded by the window whatever the file size.
+//   WindowedMappedFile file(name, options);
+//   for (std::span<const char> w = file.next(); !w.empty(); w = file.next()) { ... }
+// each window is advised SEQUENTIAL (and HUGEPAGE if asked for), the next one is announced with
+// WILLNEED while the current one is processed, and the one behind is dropped from the page cache
+// (dropBehind) so that a pass over a huge image does not push everything else out of it.
+// a window stays valid until the next call of next()
+class WindowedMappedFile {
+public:
+    struct Options {
+        size_t windowSize = 16*1024*1024; // rounded up to 2 MiB
+        bool populate = true; // prefault the window when it is mapped (MAP_POPULATE) instead of page by page
+        bool hugePages = false; // MADV_HUGEPAGE, needs a kernel and filesystem with large folios for file mappings
+        bool dropBehind = true;
+    };
+private:
+    static constexpr size_t ALIGN = 2*1024*1024; // also a multiple of the Windows allocation granularity
+    Options opt;
+    #ifdef _WIN32
+        HANDLE fileHandle = INVALID_HANDLE_VALUE;
+        HANDLE mappingHandle = nullptr;
+    #else
+        int fd = -1;
+    #endif
+    uint64_t fileSize = 0;
+    uint64_t offset = 0; // of the next window
+    void* window = nullptr;
+    size_t windowLength = 0;
+
+    void unmap() {
+        if (!window) return;
+        #ifdef _WIN32
+            UnmapViewOfFile(window);
+        #else
+            munmap(window, windowLength);
+            if (opt.dropBehind) posix_fadvise(fd, offset - windowLength, windowLength, POSIX_FADV_DONTNEED);
+        #endif
+        window = nullptr;
+        windowLength = 0;
+    }
+public:
+    WindowedMappedFile(const std::string& filename, const Options& o) : opt(o) {
+        opt.windowSize = (std::max<size_t>(1, opt.windowSize) + ALIGN - 1) / ALIGN * ALIGN;
+        #ifdef _WIN32
+            fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (fileHandle == INVALID_HANDLE_VALUE) {
+                throw std::runtime_error("failed to open file");
+            }
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(fileHandle, &size)) {
+                CloseHandle(fileHandle);
+                throw std::runtime_error("failed to get file size");
+            }
+            fileSize = size.QuadPart;
+            if (fileSize == 0) return;
+            mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mappingHandle == nullptr) {
+                CloseHandle(fileHandle);
+                throw std::runtime_error("failed to make file mapping");
+            }
+        #else
+            fd = open(filename.c_str(), O_RDONLY);
+            if (fd == -1) {
+                throw std::runtime_error("failed to open file");
+            }
+            struct stat sb;
+            if (fstat(fd, &sb) == -1) {
+                close(fd);
+                throw std::runtime_error("failed to get file information");
+            }
+            fileSize = sb.st_size;
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        #endif
+    }
+    WindowedMappedFile(const WindowedMappedFile&) = delete;
+    WindowedMappedFile& operator=(const WindowedMappedFile&) = delete;
+    ~WindowedMappedFile() {
+        unmap();
+        #ifdef _WIN32
+            if (mappingHandle) CloseHandle(mappingHandle);
+            if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        #else
+            if (fd != -1) close(fd);
+        #endif
+    }
+
+    uint64_t getSize() const { return fileSize; }
+    // file offset of the data returned by the last next()
+    uint64_t windowOffset() const { return offset - windowLength; }
+
+    // unmaps the current window and maps the following one, empty at the end of the file
+    std::span<const char> next() {
+        unmap();
+        if (offset >= fileSize) return {};
+        size_t len = static_cast<size_t>(std::min<uint64_t>(opt.windowSize, fileSize - offset));
+        #ifdef _WIN32
+            window = MapViewOfFile(mappingHandle, FILE_MAP_READ, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), len);
+            if (window == nullptr) {
+                throw std::runtime_error("failed to map memory");
+            }
+        #else
+            void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE | (opt.populate ? MAP_POPULATE : 0), fd, offset);
+            if (p == MAP_FAILED) {
+                throw std::runtime_error("failed to map memory");
+            }
+            window = p;
+            madvise(window, len, MADV_SEQUENTIAL);
+            #ifdef MADV_HUGEPAGE
+                if (opt.hugePages) madvise(window, len, MADV_HUGEPAGE);
+            #endif
+        #endif
+        windowLength = len;
+        offset += len;
+        #ifndef _WIN32
+            if (offset < fileSize) posix_fadvise(fd, offset, std::min<uint64_t>(opt.windowSize, fileSize - offset), POSIX_FADV_WILLNEED);
+        #endif
+        return {static_cast<const char*>(window), len};
+    }
+};
+
+// zero copy access to a file of T records: the file is mapped and records() points into it.
+// trailing bytes that do not fill a whole record are ignored
+template<typename T>
+class RecordView {
+    static_assert(std::is_trivially_copyable_v<T>, "records are read as raw bytes");
+private:
+    std::unique_ptr<MemoryMappedFile> mapped;
+    std::span<const T> view;
+public:
+    RecordView(const std::string& filename) {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(filename, ec);
+        if (ec) {
+            throw std::runtime_error("failed to open file");
+        }
+        if (size < sizeof(T)) return; // nothing to map
+        mapped = std::make_unique<MemoryMappedFile>(filename);
+        view = std::span<const T>(reinterpret_cast<const T*>(mapped->getData()), mapped->getSize() / sizeof(T));
+    }
+    std::span<const T> records() const { return view; }
+    size_t size() const { return view.size(); }
+    const T& operator[](size_t i) const { return view[i]; }
+};
+
+// column kernels over doubles: scalar, SSE2 and AVX2, the AVX2 ones are picked at runtime.
+// sums use several accumulators, so the kernels round differently from a plain loop and from each other
+struct ColumnKernels {
+    double (*sum)(const double*, size_t);
+    void (*minmax)(const double*, size_t, double&, double&); // NaN is not handled
+    size_t (*filter)(const double*, size_t, double, double, uint32_t*); // indices of lo <= v <= hi, returns the count
+};
+
+inline double column_sum_scalar(const double* v, size_t n) {
+    double s[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int k=0; k<4; ++k) s[k] += v[i+k];
+    }
+    for (; i<n; ++i) s[0] += v[i];
+    return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+inline void column_minmax_scalar(const double* v, size_t n, double& lo, double& hi) {
+    for (size_t i=0; i<n; ++i) {
+        lo = std::min(lo, v[i]);
+        hi = std::max(hi, v[i]);
+    }
+}
+
+inline size_t column_filter_scalar(const double* v, size_t n, double lo, double hi, uint32_t* out) {
+    size_t k = 0;
+    for (size_t i=0; i<n; ++i) {
+        out[k] = static_cast<uint32_t>(i);
+        k += lo <= v[i] && v[i] <= hi;
+    }
+    return k;
+}
+
+#if defined(__x86_64__)
+inline double column_sum_sse2(const double* v, size_t n) {
+    __m128d a = _mm_setzero_pd();
+    __m128d b = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a = _mm_add_pd(a, _mm_loadu_pd(v + i));
+        b = _mm_add_pd(b, _mm_loadu_pd(v + i + 2));
+    }
+    alignas(16) double s[2];
+    _mm_store_pd(s, _mm_add_pd(a, b));
+    return s[0] + s[1] + column_sum_scalar(v + i, n - i);
+}
+
+inline void column_minmax_sse2(const double* v, size_t n, double& lo, double& hi) {
+    __m128d mn = _mm_set1_pd(lo);
+    __m128d mx = _mm_set1_pd(hi);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(v + i);
+        mn = _mm_min_pd(mn, x);
+        mx = _mm_max_pd(mx, x);
+    }
+    alignas(16) double a[2];
+    alignas(16) double b[2];
+    _mm_store_pd(a, mn);
+    _mm_store_pd(b, mx);
+    lo = std::min(a[0], a[1]);
+    hi = std::max(b[0], b[1]);
+    column_minmax_scalar(v + i, n - i, lo, hi);
+}
+
+inline size_t column_filter_sse2(const double* v, size_t n, double lo, double hi, uint32_t* out) {
+    const __m128d l = _mm_set1_pd(lo);
+    const __m128d h = _mm_set1_pd(hi);
+    size_t k = 0;
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(v + i);
+        unsigned mask = _mm_movemask_pd(_mm_and_pd(_mm_cmple_pd(l, x), _mm_cmple_pd(x, h)));
+        for (; mask; mask &= mask - 1) out[k++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+    }
+    size_t rest = column_filter_scalar(v + i, n - i, lo, hi, out + k);
+    for (size_t j=k; j<k+rest; ++j) out[j] += static_cast<uint32_t>(i);
+    return k + rest;
+}
+
+__attribute__((target("avx2")))
+inline double column_sum_avx2(const double* v, size_t n) {
+    __m256d a[4] = {_mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd()};
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        for (int k=0; k<4; ++k) a[k] = _mm256_add_pd(a[k], _mm256_loadu_pd(v + i + 4*k));
+    }
+    alignas(32) double s[4];
+    _mm256_store_pd(s, _mm256_add_pd(_mm256_add_pd(a[0], a[1]), _mm256_add_pd(a[2], a[3])));
+    return (s[0] + s[1]) + (s[2] + s[3]) + column_sum_scalar(v + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline void column_minmax_avx2(const double* v, size_t n, double& lo, double& hi) {
+    __m256d mn[2] = {_mm256_set1_pd(lo), _mm256_set1_pd(lo)};
+    __m256d mx[2] = {_mm256_set1_pd(hi), _mm256_set1_pd(hi)};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int k=0; k<2; ++k) {
+            __m256d x = _mm256_loadu_pd(v + i + 4*k);
+            mn[k] = _mm256_min_pd(mn[k], x);
+            mx[k] = _mm256_max_pd(mx[k], x);
+        }
+    }
+    alignas(32) double a[4];
+    alignas(32) double b[4];
+    _mm256_store_pd(a, _mm256_min_pd(mn[0], mn[1]));
+    _mm256_store_pd(b, _mm256_max_pd(mx[0], mx[1]));
+    lo = std::min(std::min(a[0], a[1]), std::min(a[2], a[3]));
+    hi = std::max(std::max(b[0], b[1]), std::max(b[2], b[3]));
+    column_minmax_scalar(v + i, n - i, lo, hi);
+}
+
+__attribute__((target("avx2")))
+inline size_t column_filter_avx2(const double* v, size_t n, double lo, double hi, uint32_t* out) {
+    const __m256d l = _mm256_set1_pd(lo);
+    const __m256d h = _mm256_set1_pd(hi);
+    size_t k = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(v + i);
+        unsigned mask = _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(l, x, _CMP_LE_OQ), _mm256_cmp_pd(x, h, _CMP_LE_OQ)));
+        for (; mask; mask &= mask - 1) out[k++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+    }
+    size_t rest = column_filter_scalar(v + i, n - i, lo, hi, out + k);
+    for (size_t j=k; j<k+rest; ++j) out[j] += static_cast<uint32_t>(i);
+    return k + rest;
+}
+#endif
+
+inline const ColumnKernels& column_kernels() {
+    static const ColumnKernels kernels = [] {
+        #if defined(__x86_64__)
+            if (__builtin_cpu_supports("avx2")) return ColumnKernels{&column_sum_avx2, &column_minmax_avx2, &column_filter_avx2};
+            return ColumnKernels{&column_sum_sse2, &column_minmax_sse2, &column_filter_sse2};
+        #else
+            return ColumnKernels{&column_sum_scalar, &column_minmax_scalar, &column_filter_scalar};
+        #endif
+    }();
+    return kernels;
+}
+
+// Record file rewritten column by column, so that a scan over value reads 8 bytes per record instead of 72:
+//   header (magic, count, column offsets), ids int32[count], values double[count], names char[50][count]
+// every column starts 64 byte aligned. the file is mapped like RecordView, the columns point into it
+class RecordColumns {
+private:
+    struct Header {
+        char magic[8];
+        uint64_t count;
+        uint64_t ids_offset;
+        uint64_t values_offset;
+        uint64_t names_offset;
+        uint64_t file_size;
+    };
+    static constexpr char MAGIC[8] = {'R', 'E', 'C', 'C', 'O', 'L', '1', '\0'};
+    static constexpr size_t NAME_SIZE = sizeof(Record::name);
+    static uint64_t align64(uint64_t n) { return (n + 63) / 64 * 64; }
+
+    std::unique_ptr<MemoryMappedFile> mapped;
+    Header header{};
+public:
+    RecordColumns(const std::string& filename) : mapped(std::make_unique<MemoryMappedFile>(filename)) {
+        if (mapped->getSize() < sizeof(Header)) {
+            throw std::runtime_error("not a column file: " + filename);
+        }
+        std::memcpy(&header, mapped->getData(), sizeof(Header));
+        const uint64_t size = mapped->getSize();
+        // every column after the header, aligned for its type and inside the file, without overflowing count * width
+        auto fits = [&](uint64_t offset, size_t width, size_t align) {
+            return offset >= sizeof(Header) && offset % align == 0 && offset <= size && header.count <= (size - offset) / width;
+        };
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.file_size != size
+            || !fits(header.ids_offset, sizeof(int32_t), alignof(int32_t)) || !fits(header.values_offset, sizeof(double), alignof(double))
+            || !fits(header.names_offset, NAME_SIZE, 1)) {
+            throw std::runtime_error("not a column file: " + filename);
+        }
+    }
+
+    // rewrites a file of Record into the columnar layout, one pass per column over the mapped records
+    static void convert(const std::string& recordFile, const std::string& columnFile) {
+        RecordView<Record> records(recordFile);
+        std::ofstream ofs(columnFile, std::ios::binary | std::ios::trunc);
+        if (!ofs) {
+            throw std::runtime_error("cannot open file: " + columnFile);
+        }
+        Header h{};
+        std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.count = records.size();
+        h.ids_offset = align64(sizeof(Header));
+        h.values_offset = align64(h.ids_offset + h.count * sizeof(int32_t));
+        h.names_offset = align64(h.values_offset + h.count * sizeof(double));
+        h.file_size = h.names_offset + h.count * NAME_SIZE;
+        ofs.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        uint64_t pos = sizeof(h);
+        auto column = [&](uint64_t offset, size_t width, auto&& get) {
+            static const char pad[64] = {};
+            ofs.write(pad, offset - pos);
+            std::vector<char> block;
+            const size_t per_block = 64*1024;
+            for (size_t i=0; i<records.size(); i+=per_block) {
+                size_t n = std::min(per_block, records.size() - i);
+                block.resize(n * width);
+                for (size_t j=0; j<n; ++j) get(records[i+j], block.data() + j*width);
+                ofs.write(block.data(), block.size());
+            }
+            pos = offset + records.size() * width;
+        };
+        column(h.ids_offset, sizeof(int32_t), [](const Record& r, char* p) { int32_t id = r.id; std::memcpy(p, &id, sizeof(id)); });
+        column(h.values_offset, sizeof(double), [](const Record& r, char* p) { std::memcpy(p, &r.value, sizeof(r.value)); });
+        column(h.names_offset, NAME_SIZE, [](const Record& r, char* p) { std::memcpy(p, r.name, NAME_SIZE); });
+        if (!ofs) {
+            throw std::runtime_error("failed to write column file: " + columnFile);
+        }
+    }
+
+    size_t size() const { return header.count; }
+    std::span<const int32_t> ids() const {
+        return {reinterpret_cast<const int32_t*>(mapped->getData() + header.ids_offset), header.count};
+    }
+    std::span<const double> values() const {
+        return {reinterpret_cast<const double*>(mapped->getData() + header.values_offset), header.count};
+    }
+    // up to the first NUL, at most 50 bytes
+    std::string_view name(size_t i) const {
+        const char* p = mapped->getData() + header.names_offset + i * NAME_SIZE;
+        return std::string_view(p, strnlen(p, NAME_SIZE));
+    }
+
+    double sum() const { return column_kernels().sum(values().data(), size()); }
+    std::pair<double, double> minmax() const {
+        double lo = std::numeric_limits<double>::infinity();
+        double hi = -std::numeric_limits<double>::infinity();
+        column_kernels().minmax(values().data(), size(), lo, hi);
+        return {lo, hi};
+    }
+    // indices of the records with lo <= value <= hi
+    std::vector<uint32_t> filter(double lo, double hi) const {
+        std::vector<uint32_t> out(size());
+        out.resize(column_kernels().filter(values().data(), size(), lo, hi, out.data()));
+        return out;
+    }
+};
+
+// newline scanning: the offsets of all '\n' in [p, p+n) are written to out (room for n entries)
+// and their count is returned. scalar, SSE2 and AVX2 kernels, the AVX2 one is picked at runtime.
+inline size_t find_newlines_tail(const char* p, size_t i, size_t n, uint32_t* out) {
+    size_t k = 0;
+    for (; i<n; ++i) {
+        out[k] = static_cast<uint32_t>(i);
+        k += p[i] == '\n';
+    }
+    return k;
+}
+
+inline size_t find_newlines_scalar(const char* p, size_t n, uint32_t* out) {
+    return find_newlines_tail(p, 0, n, out);
+}
+
+#if defined(__x86_64__)
+inline size_t find_newlines_sse2(const char* p, size_t n, uint32_t* out) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t k = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), nl));
+        while (mask) {
+            out[k++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    return k + find_newlines_tail(p, i, n, out + k);
+}
+
+__attribute__((target("avx2")))
+inline size_t find_newlines_avx2(const char* p, size_t n, uint32_t* out) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t k = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t lo = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), nl)));
+        uint64_t hi = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 32)), nl)));
+        uint64_t mask = lo | (hi << 32);
+        while (mask) {
+            out[k++] = static_cast<uint32_t>(i + __builtin_ctzll(mask));
+            mask &= mask - 1;
+        }
+    }
+    return k + find_newlines_tail(p, i, n, out + k);
+}
+#endif
+
+using FindNewlinesFn = size_t (*)(const char*, size_t, uint32_t*);
+
+inline FindNewlinesFn find_newlines_kernel() {
+    static const FindNewlinesFn fn = [] {
+        #if defined(__x86_64__)
+            if (__builtin_cpu_supports("avx2")) return &find_newlines_avx2;
+            return &find_newlines_sse2;
+        #else
+            return &find_newlines_scalar;
+        #endif
+    }();
+    return fn;
+}
+
+// substring search: first match of needle (m > 0 bytes) in [p, end), or end.
+// the SIMD kernels compare the first and the last byte of the needle at 16/32 positions at once
+// and only verify the candidates where both match.
+inline const char* find_substring_scalar(const char* p, const char* end, const char* needle, size_t m) {
+    size_t pos = std::string_view(p, end - p).find(std::string_view(needle, m));
+    return pos == std::string_view::npos ? end : p + pos;
+}
+
+#if defined(__x86_64__)
+inline const char* find_substring_sse2(const char* p, const char* end, const char* needle, size_t m) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m-1]);
+    for (; end - p >= static_cast<ptrdiff_t>(m + 15); p += 16) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), first);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + m - 1)), last);
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+        while (mask) {
+            const char* candidate = p + __builtin_ctz(mask);
+            if (std::memcmp(candidate, needle, m) == 0) return candidate;
+            mask &= mask - 1;
+        }
+    }
+    return find_substring_scalar(p, end, needle, m);
+}
+
+__attribute__((target("avx2")))
+inline const char* find_substring_avx2(const char* p, const char* end, const char* needle, size_t m) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m-1]);
+    for (; end - p >= static_cast<ptrdiff_t>(m + 31); p += 32) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), first);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + m - 1)), last);
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+        while (mask) {
+            const char* candidate = p + __builtin_ctz(mask);
+            if (std::memcmp(candidate, needle, m) == 0) return candidate;
+            mask &= mask - 1;
+        }
+    }
+    return find_substring_scalar(p, end, needle, m);
+}
+#endif
+
+using FindSubstringFn = const char* (*)(const char*, const char*, const char*, size_t);
+
+inline FindSubstringFn find_substring_kernel() {
+    static const FindSubstringFn fn = [] {
+        #if defined(__x86_64__)
+            if (__builtin_cpu_supports("avx2")) return &find_substring_avx2;
+            return &find_substring_sse2;
+        #else
+            return &find_substring_scalar;
+        #endif
+    }();
+    return fn;
+}
+
+// calls f(std::string_view) for every non-empty line in [begin, end), without the '\n'.
+// the newlines are collected per block by the kernel, so f is inlined into the loop.
+// returns the number of bytes consumed: up to the last '\n', or everything if final
+// (the unterminated last line is passed on as well).
+template<typename F>
+size_t for_each_line(const char* begin, const char* end, bool final, F&& f) {
+    constexpr size_t BLOCK = 16*1024;
+    uint32_t offsets[BLOCK];
+    const FindNewlinesFn find_newlines = find_newlines_kernel();
+    const char* line = begin;
+    for (const char* block=begin; block<end; block+=BLOCK) {
+        size_t n = std::min<size_t>(BLOCK, end - block);
+        size_t count = find_newlines(block, n, offsets);
+        for (size_t i=0; i<count; ++i) {
+            const char* nl = block + offsets[i];
+            if (nl != line) f(std::string_view(line, nl - line));
+            line = nl + 1;
+        }
+    }
+    if (final && line < end) {
+        f(std::string_view(line, end - line));
+        line = end;
+    }
+    return line - begin;
+}
+
+// regular files are mapped, everything else (pipes, /proc) is read in large blocks.
+// lines are handed out as std::string_view into the mapping or the block, valid during the call only.
+class LineReader {
+private:
+    std::string filename;
+    std::ifstream file;
+    static constexpr size_t READ_SIZE = 1024*1024;
+
+    // the mapping if filename is a non-empty regular file
+    std::unique_ptr<MemoryMappedFile> map() const {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(filename, ec);
+        if (ec || size == 0) return nullptr;
+        return std::make_unique<MemoryMappedFile>(filename, MemoryMappedFile::Access::Sequential);
+    }
+
+    // all lines in [begin, end) containing searchStr
+    static void collect(const char* begin, const char* end, const std::string& searchStr, std::vector<std::string>& matches) {
+        if (searchStr.empty()) {
+            for_each_line(begin, end, true, [&](std::string_view line) { matches.emplace_back(line); });
+            return;
+        }
+        const FindSubstringFn find_substring = find_substring_kernel();
+        const char* pos = begin;
+        while (pos < end) {
+            const char* hit = find_substring(pos, end, searchStr.data(), searchStr.size());
+            if (hit == end) break;
+            const char* line = hit;
+            while (line > pos && line[-1] != '\n') --line;
+            const char* nl = static_cast<const char*>(std::memchr(hit, '\n', end - hit));
+            if (!nl) nl = end;
+            matches.emplace_back(line, nl);
+            pos = nl + 1;
+        }
+    }
+public:
+    LineReader(const std::string& filename) : filename(filename), file(filename, std::ios::binary) {
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to open file");
+        }
+    }
+    // calls processor(std::string_view) for every non-empty line
+    template<typename F>
+    void processLineByLine(F&& processor) {
+        if (auto mapped = map()) {
+            for_each_line(mapped->getData(), mapped->getData() + mapped->getSize(), true, processor);
+            return;
+        }
+        std::vector<char> buffer(READ_SIZE);
+        size_t have = 0;
+        while (true) {
+            if (buffer.size() - have < READ_SIZE / 2) buffer.resize(buffer.size() * 2); // line longer than the buffer
+            file.read(buffer.data() + have, buffer.size() - have);
+            size_t got = file.gcount();
+            have += got;
+            size_t used = for_each_line(buffer.data(), buffer.data() + have, got == 0, processor);
+            std::memmove(buffer.data(), buffer.data() + used, have - used);
+            have -= used;
+            if (got == 0) break;
+        }
+        file.clear();
+        file.seekg(0);
+    }
+    // numThreads > 1 splits the file at line boundaries and searches the parts in parallel,
+    // the matches keep the file order either way. 0 uses all cores.
+    std::vector<std::string> findLines(const std::string& searchStr, size_t numThreads=1) {
+        std::vector<std::string> matches;
+        if (searchStr.find('\n') != std::string::npos) return matches;
+        auto mapped = map();
+        if (!mapped) {
+            processLineByLine([&](std::string_view line) {
+                if (line.find(searchStr) != std::string_view::npos) {
+                    matches.emplace_back(line);
+                }
+            });
+            return matches;
+        }
+        const char* data = mapped->getData();
+        const char* end = data + mapped->getSize();
+        if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+        numThreads = std::clamp<size_t>(mapped->getSize() / READ_SIZE, 1, numThreads);
+        if (numThreads == 1) {
+            collect(data, end, searchStr, matches);
+            return matches;
+        }
+        std::vector<const char*> bounds(numThreads + 1, end);
+        bounds[0] = data;
+        for (size_t i=1; i<numThreads; ++i) {
+            const char* p = std::max(bounds[i-1], data + mapped->getSize() * i / numThreads);
+            const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            bounds[i] = nl ? nl + 1 : end;
+        }
+        std::vector<std::vector<std::string>> parts(numThreads);
+        std::vector<std::thread> threads;
+        for (size_t i=0; i<numThreads; ++i) {
+            threads.emplace_back([&, i] { collect(bounds[i], bounds[i+1], searchStr, parts[i]); });
+        }
+        for (std::thread& t : threads) t.join();
+        for (std::vector<std::string>& part : parts) {
+            std::move(part.begin(), part.end(), std::back_inserter(matches));
+        }
+        return matches;
+    }
+};
+
+class BufferedReader {
+private:
+    std::ifstream file;
+    std::vector<char> buffer;
+    size_t bufferSize;
+    size_t position;
+    size_t dataInBuffer;
+public:
+    BufferedReader(const std::string& filename, size_t bufferSize=8192) :
+        file(filename, std::ios::binary),
+        buffer(bufferSize),
+        bufferSize(bufferSize),
+        position(0),
+        dataInBuffer(0)
+        {
+            if (!file.is_open()) {
+                throw std::runtime_error("failed to open file");
+            }
+        }
+    size_t read(char* data, size_t size) {
+        size_t totalBytesRead = 0;
+        while (totalBytesRead < size) {
+            if (position >= dataInBuffer) {
+                file.read(buffer.data(), bufferSize);
+                dataInBuffer = file.gcount();
+                position = 0;
+                if (dataInBuffer == 0) break;
+            }
+            size_t bytesToCopy = std::min(size-totalBytesRead, dataInBuffer-position);
+            std::memcpy(data + totalBytesRead, buffer.data() + position, bytesToCopy);
+            position += bytesToCopy;
+            totalBytesRead += bytesToCopy;
+        }
+        return totalBytesRead;
+    }
+};
+
+#ifdef LINUX_PLATFORM
+// asynchronous reads of many files through a fixed set of buffers: up to queueDepth reads are in flight,
+// at most buffersPerFile of them for one file, so several files are read at the same time and every file
+// is read ahead by a few buffers. io_uring (raw syscalls, IORING_OP_READV) when the kernel allows it,
+// pread on worker threads otherwise. a file is read up to the size it had when it was opened,
+// a short read is continued where it stopped and only the end of the file ends it early (the file shrank).
+//   reader.readFiles(files, [](size_t file, const char* data, size_t len) { ... }, [](size_t file, int error) { ... });
+// onData gets the data of each file in order (buffers of the different files interleave) and is
+// called on the calling thread, the buffer is reused once it returns. onDone follows once per file,
+// error is 0 or an errno value
+class AsyncReader {
+public:
+    struct Options {
+        size_t queueDepth = 16;
+        size_t bufferSize = 1024*1024; // rounded up to 4 KiB
+        size_t buffersPerFile = 3;
+        size_t threads = 4; // pread fallback only
+        bool useUring = true;
+    };
+
+    AsyncReader(const Options& o) : opt(o) {
+        opt.queueDepth = std::max<size_t>(1, opt.queueDepth);
+        opt.buffersPerFile = std::max<size_t>(1, opt.buffersPerFile);
+        opt.bufferSize = (std::max<size_t>(1, opt.bufferSize) + 4095) / 4096 * 4096;
+        buffers.reset(static_cast<char*>(std::aligned_alloc(4096, opt.queueDepth * opt.bufferSize)));
+        if (!buffers) {
+            throw std::runtime_error("failed to allocate read buffers");
+        }
+        iovecs.resize(opt.queueDepth);
+        if (opt.useUring) {
+            try {
+                uring = std::make_unique<Uring>(static_cast<unsigned>(opt.queueDepth));
+            } catch (const std::runtime_error&) {
+                // no io_uring (old kernel, seccomp), use the fallback
+            }
+        }
+        if (!uring) preads = std::make_unique<PreadPool>(std::max<size_t>(1, opt.threads));
+    }
+
+    const char* backend() const { return uring ? "io_uring" : "pread"; }
+    const Options& options() const { return opt; }
+
+    template<typename OnData, typename OnDone>
+    void readFiles(const std::vector<std::string>& files, OnData&& onData, OnDone&& onDone) {
+        std::list<Active> active;
+        std::vector<Active*> owner(opt.queueDepth, nullptr);
+        std::vector<uint64_t> slotOffset(opt.queueDepth, 0);
+        std::vector<size_t> slotLength(opt.queueDepth, 0); // requested
+        std::vector<size_t> slotFilled(opt.queueDepth, 0); // read so far, a read may return less than requested
+        std::vector<uint32_t> freeSlots;
+        for (size_t i=opt.queueDepth; i>0; --i) freeSlots.push_back(static_cast<uint32_t>(i - 1));
+        std::vector<Completion> completions;
+        size_t next = 0;
+        size_t inflight = 0;
+        // reads must not outlive the buffers or the descriptors, so an exception waits for them first
+        auto drain = [&] {
+            while (inflight > 0) {
+                completions.clear();
+                wait(completions);
+                inflight -= completions.size();
+            }
+            for (Active& a : active) close(a.fd);
+        };
+        try {
+            while (true) {
+                while (active.size() < opt.queueDepth && next < files.size()) {
+                    size_t file = next++;
+                    int fd = open(files[file].c_str(), O_RDONLY | O_CLOEXEC);
+                    struct stat sb;
+                    if (fd == -1 || fstat(fd, &sb) == -1) {
+                        int error = errno;
+                        if (fd != -1) close(fd);
+                        onDone(file, error);
+                        continue;
+                    }
+                    if (sb.st_size == 0) {
+                        close(fd);
+                        onDone(file, 0);
+                        continue;
+                    }
+                    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                    active.push_back(Active{file, fd, static_cast<uint64_t>(sb.st_size), 0, 0, 0, 0, {}});
+                }
+                // round robin, so that every open file gets a buffer before one gets its second
+                for (bool progress=true; progress && !freeSlots.empty();) {
+                    progress = false;
+                    for (Active& a : active) {
+                        if (freeSlots.empty()) break;
+                        if (a.error != 0 || a.submitted >= a.size || a.inflight >= opt.buffersPerFile) continue;
+                        uint32_t slot = freeSlots.back();
+                        freeSlots.pop_back();
+                        size_t len = std::min<uint64_t>(opt.bufferSize, a.size - a.submitted);
+                        iovecs[slot].iov_base = buffer(slot);
+                        iovecs[slot].iov_len = len;
+                        submit(a.fd, slot, a.submitted);
+                        owner[slot] = &a;
+                        slotOffset[slot] = a.submitted;
+                        slotLength[slot] = len;
+                        slotFilled[slot] = 0;
+                        a.submitted += len;
+                        a.inflight++;
+                        inflight++;
+                        progress = true;
+                    }
+                }
+                if (inflight == 0) break;
+                completions.clear();
+                wait(completions);
+                for (const Completion& c : completions) {
+                    Active& a = *owner[c.slot];
+                    a.inflight--;
+                    inflight--;
+                    uint64_t off = slotOffset[c.slot];
+                    if (c.result < 0) {
+                        if (a.error == 0) a.error = static_cast<int>(-c.result);
+                        freeSlots.push_back(c.slot);
+                        continue;
+                    }
+                    size_t filled = slotFilled[c.slot] += static_cast<size_t>(c.result);
+                    if (c.result > 0 && filled < slotLength[c.slot]) {
+                        // short read, not the end of the file yet: read the rest into the same buffer
+                        iovecs[c.slot].iov_base = buffer(c.slot) + filled;
+                        iovecs[c.slot].iov_len = slotLength[c.slot] - filled;
+                        submit(a.fd, c.slot, off + filled);
+                        a.inflight++;
+                        inflight++;
+                        continue;
+                    }
+                    if (filled < slotLength[c.slot]) a.size = std::min<uint64_t>(a.size, off + filled);
+                    a.ready.emplace(off, std::make_pair(c.slot, filled));
+                }
+                for (auto it=active.begin(); it!=active.end();) {
+                    Active& a = *it;
+                    for (auto r=a.ready.begin(); a.error == 0 && r != a.ready.end() && r->first == a.delivered && a.delivered < a.size; r=a.ready.erase(r)) {
+                        size_t len = std::min<uint64_t>(r->second.second, a.size - a.delivered);
+                        onData(a.file, buffer(r->second.first), len);
+                        a.delivered += len;
+                        freeSlots.push_back(r->second.first);
+                    }
+                    if ((a.error != 0 || a.delivered >= a.size) && a.inflight == 0) {
+                        for (const auto& r : a.ready) freeSlots.push_back(r.second.first);
+                        close(a.fd);
+                        onDone(a.file, a.error);
+                        it = active.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+        } catch (...) {
+            drain();
+            throw;
+        }
+    }
+
+private:
+    struct Active {
+        size_t file;
+        int fd;
+        uint64_t size;
+        uint64_t submitted = 0;
+        uint64_t delivered = 0;
+        size_t inflight = 0;
+        int error = 0;
+        std::map<uint64_t, std::pair<uint32_t, size_t>> ready; // offset -> (slot, length), completed out of order
+    };
+    struct Completion {
+        uint32_t slot;
+        int64_t result; // bytes or -errno
+    };
+
+    // the submission and completion rings mapped from the kernel, one readv per buffer
+    class Uring {
+    private:
+        int ringFd = -1;
+        void* sqRing = MAP_FAILED;
+        void* cqRing = MAP_FAILED;
+        size_t sqRingSize = 0;
+        size_t cqRingSize = 0;
+        io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        size_t sqesSize = 0;
+        unsigned* sqTail;
+        unsigned* sqMask;
+        unsigned* sqArray;
+        unsigned* cqHead;
+        unsigned* cqTail;
+        unsigned* cqMask;
+        io_uring_cqe* cqes;
+        unsigned pending = 0; // pushed, not yet submitted
+
+        void release() {
+            if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+            if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+            if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+            if (ringFd != -1) close(ringFd);
+        }
+    public:
+        Uring(unsigned entries) {
+            io_uring_params p{};
+            ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+            if (ringFd < 0) {
+                throw std::runtime_error("io_uring_setup failed");
+            }
+            sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+            if (single) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+            sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+            cqRing = single ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+            sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+            sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+            if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+                release();
+                throw std::runtime_error("failed to map io_uring");
+            }
+            char* sq = static_cast<char*>(sqRing);
+            char* cq = static_cast<char*>(cqRing);
+            sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+            sqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+            sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+            cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+            cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+            cqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        }
+        ~Uring() { release(); }
+        Uring(const Uring&) = delete;
+        Uring& operator=(const Uring&) = delete;
+
+        void push(int fd, const iovec* iov, uint64_t offset, uint32_t slot) {
+            unsigned tail = *sqTail;
+            unsigned index = tail & *sqMask;
+            io_uring_sqe& e = sqes[index];
+            std::memset(&e, 0, sizeof(e));
+            e.opcode = IORING_OP_READV;
+            e.fd = fd;
+            e.addr = reinterpret_cast<uint64_t>(iov);
+            e.len = 1;
+            e.off = offset;
+            e.user_data = slot;
+            sqArray[index] = index;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            pending++;
+        }
+        // submits everything pushed so far with one syscall and waits for at least one completion
+        void wait(std::vector<Completion>& out) {
+            int n = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (n < 0 && errno != EINTR) {
+                throw std::runtime_error("io_uring_enter failed");
+            }
+            if (n > 0) pending -= n;
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const io_uring_cqe& c = cqes[head & *cqMask];
+                out.push_back(Completion{static_cast<uint32_t>(c.user_data), c.res});
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+    };
+
+    class PreadPool {
+    private:
+        struct Request {
+            int fd;
+            iovec iov;
+            uint64_t offset;
+            uint32_t slot;
+        };
+        std::vector<std::thread> threads;
+        std::mutex m;
+        std::condition_variable cvRequest;
+        std::condition_variable cvDone;
+        std::deque<Request> requests;
+        std::vector<Completion> done;
+        bool stopping = false;
+
+        void run() {
+            while (true) {
+                Request r;
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    cvRequest.wait(lock, [this] { return stopping || !requests.empty(); });
+                    if (requests.empty()) return;
+                    r = requests.front();
+                    requests.pop_front();
+                }
+                int64_t total = 0;
+                while (total < static_cast<int64_t>(r.iov.iov_len)) {
+                    ssize_t n = pread(r.fd, static_cast<char*>(r.iov.iov_base) + total, r.iov.iov_len - total, r.offset + total);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n < 0) {
+                        total = -errno;
+                        break;
+                    }
+                    if (n == 0) break;
+                    total += n;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    done.push_back(Completion{r.slot, total});
+                }
+                cvDone.notify_one();
+            }
+        }
+    public:
+        PreadPool(size_t n) {
+            for (size_t i=0; i<n; ++i) threads.emplace_back(&PreadPool::run, this);
+        }
+        ~PreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stopping = true;
+            }
+            cvRequest.notify_all();
+            for (std::thread& t : threads) t.join();
+        }
+        void push(int fd, const iovec* iov, uint64_t offset, uint32_t slot) {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                requests.push_back(Request{fd, *iov, offset, slot});
+            }
+            cvRequest.notify_one();
+        }
+        void wait(std::vector<Completion>& out) {
+            std::unique_lock<std::mutex> lock(m);
+            cvDone.wait(lock, [this] { return !done.empty(); });
+            out.insert(out.end(), done.begin(), done.end());
+            done.clear();
+        }
+    };
+
+    struct FreeDeleter {
+        void operator()(char* p) const { std::free(p); }
+    };
+
+    Options opt;
+    std::unique_ptr<char, FreeDeleter> buffers;
+    std::vector<iovec> iovecs; // per slot, must stay put while the read is in flight
+    std::unique_ptr<Uring> uring;
+    std::unique_ptr<PreadPool> preads;
+
+    char* buffer(uint32_t slot) const { return buffers.get() + slot * opt.bufferSize; }
+    void submit(int fd, uint32_t slot, uint64_t offset) {
+        if (uring) {
+            uring->push(fd, &iovecs[slot], offset, slot);
+        } else {
+            preads->push(fd, &iovecs[slot], offset, slot);
+        }
+    }
+    void wait(std::vector<Completion>& out) {
+        if (uring) {
+            uring->wait(out);
+        } else {
+            preads->wait(out);
+        }
+    }
+};
+#endif
@@ -0,0 +1,82 @@
+#!/bin/sh
+# end to end check of the copy engine (--copy-to), between two filesystems:
+#
+#   test/copy_engine.sh BINARY SRC_DIR DST_DIR
+#
+# builds a small tree in SRC_DIR (nested directories, empty, small and multi MB files, names with
+# spaces, symlinks to a file and a directory, a dangling symlink, old mtimes), copies it into DST_DIR
+# and compares types, file contents, mtimes and link targets. a second run must copy nothing,
+# a third one only the file changed in between. the scan root of BINARY ($HOME/220_cpp/01_mybackup)
+# is pointed at the tree through a temporary HOME.
+#
+# the interesting pairs are different filesystems, e.g. as root:
+#   mkdir -p /mnt/a && mount -t tmpfs tmpfs /mnt/a
+#   test/copy_engine.sh bin/0.0.0/main-0.0.0 /mnt/a /var/tmp            (tmpfs -> ext4: sendfile fallback)
+#   test/copy_engine.sh bin/0.0.0/main-0.0.0 /var/tmp /var/tmp          (same ext4: copy_file_range)
+#   test/copy_engine.sh bin/0.0.0/main-0.0.0 /mnt/btrfs /mnt/btrfs      (reflinked)
+set -eu
+
+if [ $# -ne 3 ]; then
+    echo "usage: $0 BINARY SRC_DIR DST_DIR" >&2
+    exit 2
+fi
+bin=$(realpath "$1")
+src="$2/copy_engine_src.$$"
+dst="$3/copy_engine_dst.$$"
+home=$(mktemp -d)
+trap 'rm -rf "$src" "$dst" "$home"' EXIT
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+mkdir -p "$src/a/b/c" "$src/with space" "$src/empty dir"
+: > "$src/empty"
+echo "small file" > "$src/a/small.txt"
+head -c 5000000 /dev/urandom > "$src/a/b/large.bin"
+echo "deep" > "$src/a/b/c/deep.txt"
+echo "spaces" > "$src/with space/name with space.txt"
+ln -s small.txt "$src/a/link_to_file"
+ln -s b "$src/a/link_to_dir"
+ln -s does_not_exist "$src/a/dangling"
+touch -h -d "2001-02-03 04:05:06.789" "$src/a/small.txt" "$src/a/b/large.bin" "$src/a/link_to_dir"
+touch -d "2002-03-04 05:06:07" "$src/a/b/c" "$src/empty dir"
+
+mkdir -p "$home/220_cpp"
+ln -s "$src" "$home/220_cpp/01_mybackup"
+
+copy() {
+    HOME="$home" "$bin" --copy-to "$dst" -j 4 2>&1 | grep '^copy:' || fail "no copy summary"
+}
+
+# type, path, mtime and link target of every entry below the tree root
+listing() {
+    (cd "$1" && find . -mindepth 1 -printf '%y %p %T@ %l\n' | sort)
+}
+
+check() {
+    listing "$src" > "$home/src.txt"
+    listing "$dst" > "$home/dst.txt"
+    diff "$home/src.txt" "$home/dst.txt" >&2 || fail "trees differ (type, mtime or link target)"
+    (cd "$src" && find . -type f) | while IFS= read -r f; do
+        cmp -s "$src/$f" "$dst/$f" || fail "content differs: $f"
+    done
+}
+
+out=$(copy)
+echo "first run:  $out"
+case "$out" in *" 0 failed"*) ;; *) fail "first run failed: $out" ;; esac
+check
+
+out=$(copy)
+echo "second run: $out"
+case "$out" in "copy: 0 copied"*) ;; *) fail "second run copied again: $out" ;; esac
+
+echo "changed" >> "$src/a/b/c/deep.txt"
+out=$(copy)
+echo "third run:  $out"
+case "$out" in "copy: 1 copied"*) ;; *) fail "third run should copy one file: $out" ;; esac
+check
+
+echo "ok"
@@ -0,0 +1,103 @@
+#!/bin/sh
+# end to end check of the snapshot diff (--save-snapshot, then --diff):
+#
+#   test/snapshot_diff.sh BINARY [WORK_DIR]
+#
+# builds a fixture tree in WORK_DIR (default /tmp), saves a snapshot of it, changes it in known ways
+# and compares the change set of --diff with the expected one:
+#   added      a new file, a new directory with its content, a renamed file that was also changed (new name)
+#   removed    a file, a directory with its content, a renamed file that was also changed (old name)
+#   modified   a file that grew, a file with a new mtime
+#   renamed    a file, a directory (its content moves along and is not listed)
+# a second part changes every 7th file of a directory large enough to be split into several parts
+# and checks that the change set is the same with one and with eight threads.
+# the scan root of BINARY ($HOME/220_cpp/01_mybackup) is pointed at the tree through a temporary HOME.
+set -eu
+
+if [ $# -lt 1 ] || [ $# -gt 2 ]; then
+    echo "usage: $0 BINARY [WORK_DIR]" >&2
+    exit 2
+fi
+bin=$(realpath "$1")
+work=$(mktemp -d "${2:-/tmp}/snapshot_diff.XXXXXX")
+trap 'rm -rf "$work"' EXIT
+tree="$work/tree"
+root="$work/home/220_cpp/01_mybackup"
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+mkdir -p "$tree/keep" "$tree/removed_dir" "$tree/olddir/sub" "$work/home/220_cpp"
+ln -s "$tree" "$root"
+for f in keep/unchanged.txt keep/grows.txt keep/touched.txt removed.txt removed_dir/a removed_dir/b \
+         renamed_file.txt renamed_changed.txt olddir/x.txt olddir/sub/y.txt; do
+    echo "$f" > "$tree/$f"
+done
+find "$tree" -mindepth 1 -exec touch -d "2020-01-02 03:04:05" {} +
+
+# -j 1 unless given
+diff_run() {
+    HOME="$work/home" "$bin" "$@" > /dev/null 2>&1 || fail "$bin $* failed"
+}
+
+# op, path and (for renames) the old path of every line, relative to the root
+changes() {
+    sed -e "s|$root/||g" \
+        -e 's|^{"op":"\([a-z]*\)","path":"\([^"]*\)".*,"from":"\([^"]*\)"}$|\1 \2 \3|' \
+        -e 's|^{"op":"\([a-z]*\)","path":"\([^"]*\)".*|\1 \2|' "$1" | sort
+}
+
+diff_run --save-snapshot "$work/before.snap"
+
+# additions first, so that none of them gets the inode of a removed entry
+echo added > "$tree/added.txt"
+mkdir "$tree/added_dir"
+echo added > "$tree/added_dir/c.txt"
+echo more >> "$tree/keep/grows.txt"
+touch -d "2021-01-02 03:04:05" "$tree/keep/touched.txt"
+mv "$tree/renamed_file.txt" "$tree/renamed_file2.txt"
+mv "$tree/olddir" "$tree/newdir"
+mv "$tree/renamed_changed.txt" "$tree/renamed_changed2.txt"
+echo more >> "$tree/renamed_changed2.txt"
+rm "$tree/removed.txt"
+rm -r "$tree/removed_dir"
+
+diff_run --diff "$work/before.snap" --output "$work/diff.ndjson"
+changes "$work/diff.ndjson" > "$work/actual.txt"
+sort > "$work/expected.txt" <<EOF
+added added.txt
+added added_dir
+added added_dir/c.txt
+added renamed_changed2.txt
+modified keep/grows.txt
+modified keep/touched.txt
+removed removed.txt
+removed removed_dir
+removed removed_dir/a
+removed removed_dir/b
+removed renamed_changed.txt
+renamed newdir olddir
+renamed renamed_file2.txt renamed_file.txt
+EOF
+diff "$work/expected.txt" "$work/actual.txt" >&2 || fail "unexpected change set"
+echo "fixture: $(wc -l < "$work/actual.txt") changes as expected"
+
+# a depth of more than 16384 entries is joined in several parts, their output has to come out in order
+mkdir "$tree/bulk"
+(cd "$tree/bulk" && seq 1 40000 | sed 's/^/f/' | xargs touch -d "2020-01-02 03:04:05")
+diff_run --save-snapshot "$work/before.snap"
+(cd "$tree/bulk" && seq 7 7 40000 | sed 's/^/f/' | xargs rm)
+(cd "$tree/bulk" && seq 40001 40500 | sed 's/^/f/' | xargs touch)
+(cd "$tree/bulk" && seq 3 7 40000 | sed 's/^/f/' | xargs touch)
+diff_run --diff "$work/before.snap" --output "$work/j1.ndjson" -j 1
+diff_run --diff "$work/before.snap" --output "$work/j8.ndjson" -j 8
+cmp -s "$work/j1.ndjson" "$work/j8.ndjson" || fail "change set depends on the number of threads"
+for op in added removed modified; do
+    echo "$op $(grep -c "^{\"op\":\"$op\"" "$work/j8.ndjson")"
+done > "$work/counts.txt"
+printf 'added 500\nremoved 5714\nmodified 5714\n' | diff - "$work/counts.txt" >&2 || fail "unexpected counts"
+echo "bulk: $(wc -l < "$work/j8.ndjson") changes, same with 1 and 8 threads"
+
+echo "ok"